@@ -0,0 +1,297 @@
+// chat_load: load generator for shellish's fifo chatroom. spawns N simulated users
+// in one room, speaking the same protocol as the shell (a fifo per user under
+// /tmp/chatroom-<room>/, 2 byte length framed messages). every user sends at a
+// fixed rate to everyone else and measures end-to-end delivery latency from the
+// timestamp inside each message. real shellish clients can join the room while
+// it runs.
+//
+// -f switches the senders to the old design (fork one child per recipient per
+// message), so a transport change can be compared against it.
+//
+// usage: chat_load [-n users] [-m msgs_per_user] [-r msgs_per_sec] [-s payload]
+//                  [-R room] [-f]
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FRAME_MAX 1024 // same as CHAT_FRAME_MAX in the shell
+#define HIST_SUB 8     // log-linear latency histogram: 8 buckets per power of two
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct user_stats {
+  uint64_t hist[HIST_BUCKETS];
+  uint64_t received;     // loadgen messages delivered to this user
+  uint64_t gaps;         // sequence numbers that never arrived
+  uint64_t partial;      // frames that didn't parse as a whole message
+  uint64_t send_eagain;  // sends skipped because the reader's fifo was full
+  uint64_t sent;
+};
+
+struct shared {
+  _Atomic int ready;
+  struct user_stats users[];
+};
+
+static int n_users = 50, msgs = 100, rate = 10, payload = 64;
+static bool fork_mode = false;
+static const char *room = "loadtest";
+static char room_dir[256];
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_bucket(uint64_t v) {
+  if (v < HIST_SUB) return (int)v;
+  int msb = 63 - __builtin_clzll(v);
+  int sub = (int)((v >> (msb - 3)) & (HIST_SUB - 1));
+  return (msb - 2) * HIST_SUB + sub;
+}
+
+static uint64_t hist_value(int b) { // lower bound of a bucket
+  if (b < HIST_SUB) return b;
+  int msb = b / HIST_SUB + 2, sub = b % HIST_SUB;
+  return ((uint64_t)(HIST_SUB + sub)) << (msb - 3);
+}
+
+static void user_path(char *buf, size_t size, int u) {
+  snprintf(buf, size, "%s/u%d", room_dir, u);
+}
+
+static size_t make_frame(char *frame, int self, int seq) {
+  char msg[FRAME_MAX];
+  int len = snprintf(msg, sizeof(msg), "[%s] u%d: LOADGEN %d %d %llu ", room, self, self, seq,
+                     (unsigned long long)now_ns());
+  while (len < payload + 40 && len < FRAME_MAX - 1) msg[len++] = 'x';
+  msg[len++] = '\n';
+  frame[0] = len & 0xff;
+  frame[1] = len >> 8;
+  memcpy(frame + 2, msg, len);
+  return len + 2;
+}
+
+static void handle_message(struct user_stats *st, int *next_seq, const char *msg, size_t len) {
+  char text[FRAME_MAX + 1];
+  memcpy(text, msg, len);
+  text[len] = 0;
+  const char *tag = strstr(text, "LOADGEN ");
+  int sender, seq;
+  unsigned long long sent_at;
+  if (tag == NULL || sscanf(tag, "LOADGEN %d %d %llu", &sender, &seq, &sent_at) != 3 ||
+      sender < 0 || sender >= n_users || text[len - 1] != '\n') {
+    if (tag != NULL || len == 0) st->partial++; // someone real typing in the room is fine
+    return;
+  }
+  st->hist[hist_bucket(now_ns() - sent_at)]++;
+  st->received++;
+  if (seq > next_seq[sender]) st->gaps += seq - next_seq[sender];
+  if (seq >= next_seq[sender]) next_seq[sender] = seq + 1;
+}
+
+static void receive(int fifo, char *buf, size_t *fill, struct user_stats *st, int *next_seq) {
+  while (1) {
+    ssize_t n = read(fifo, buf + *fill, 4 * FRAME_MAX - *fill);
+    if (n <= 0) return;
+    *fill += n;
+    size_t pos = 0;
+    while (*fill - pos >= 2) {
+      size_t len = (unsigned char)buf[pos] | ((unsigned char)buf[pos + 1] << 8);
+      if (len > FRAME_MAX) { // lost framing
+        st->partial++;
+        pos = *fill;
+        break;
+      }
+      if (*fill - pos < len + 2) break;
+      handle_message(st, next_seq, buf + pos + 2, len);
+      pos += len + 2;
+    }
+    memmove(buf, buf + pos, *fill - pos);
+    *fill -= pos;
+  }
+}
+
+//the old chatroom sender: one child per recipient, each doing open/write/close
+static void send_forked(int self, const char *frame, size_t len) {
+  for (int u = 0; u < n_users; u++) {
+    if (u == self) continue;
+    if (fork() == 0) {
+      char path[512];
+      user_path(path, sizeof(path), u);
+      int fd = open(path, O_WRONLY | O_NONBLOCK);
+      if (fd >= 0) {
+        write(fd, frame, len);
+        close(fd);
+      }
+      _exit(0);
+    }
+  }
+  while (waitpid(-1, NULL, WNOHANG) > 0) {}
+}
+
+static void run_user(int self, struct shared *sh) {
+  struct user_stats *st = &sh->users[self];
+  char path[512];
+  user_path(path, sizeof(path), self);
+  int fifo = open(path, O_RDWR | O_NONBLOCK);
+  if (fifo < 0) _exit(1);
+
+  atomic_fetch_add(&sh->ready, 1);
+  while (atomic_load(&sh->ready) < n_users) usleep(1000);
+
+  //cached fds, like the shell's sender
+  int *fds = calloc(n_users, sizeof(int));
+  if (!fork_mode)
+    for (int u = 0; u < n_users; u++) {
+      char other[512];
+      user_path(other, sizeof(other), u);
+      fds[u] = u == self ? -1 : open(other, O_WRONLY | O_NONBLOCK);
+    }
+
+  int ep = epoll_create1(0);
+  struct epoll_event ev = {.events = EPOLLIN};
+  epoll_ctl(ep, EPOLL_CTL_ADD, fifo, &ev);
+
+  int *next_seq = calloc(n_users, sizeof(int));
+  char buf[4 * FRAME_MAX];
+  size_t fill = 0;
+  uint64_t interval = 1000000000ull / rate;
+  uint64_t next_send = now_ns() + (uint64_t)(rand() % 1000) * (interval / 1000);
+  uint64_t expected = (uint64_t)(n_users - 1) * msgs;
+  uint64_t quiet_until = 0;
+  int seq = 0;
+
+  while (1) {
+    uint64_t t = now_ns();
+    if (seq < msgs && t >= next_send) {
+      char frame[FRAME_MAX + 2];
+      size_t len = make_frame(frame, self, seq++);
+      if (fork_mode) {
+        send_forked(self, frame, len);
+      } else {
+        for (int u = 0; u < n_users; u++) {
+          if (fds[u] < 0) continue;
+          if (write(fds[u], frame, len) < 0 && errno == EAGAIN) st->send_eagain++;
+        }
+      }
+      st->sent++;
+      next_send += interval;
+      if (seq == msgs) quiet_until = now_ns() + 2000000000ull; // then drain for a while
+      continue;
+    }
+    if (seq == msgs && (st->received >= expected || t >= quiet_until)) break;
+
+    uint64_t wake = seq < msgs ? next_send : quiet_until;
+    int timeout_ms = wake > t ? (int)((wake - t) / 1000000) : 0;
+    struct epoll_event out;
+    if (epoll_wait(ep, &out, 1, timeout_ms) > 0)
+      receive(fifo, buf, &fill, st, next_seq);
+  }
+
+  //sequence numbers that never showed up at the end count as gaps too
+  for (int u = 0; u < n_users; u++)
+    if (u != self && next_seq[u] < msgs) st->gaps += msgs - next_seq[u];
+  if (fork_mode) while (wait(NULL) > 0) {}
+  _exit(0);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:m:r:s:R:f")) != -1) {
+    switch (opt) {
+    case 'n': n_users = atoi(optarg); break;
+    case 'm': msgs = atoi(optarg); break;
+    case 'r': rate = atoi(optarg); break;
+    case 's': payload = atoi(optarg); break;
+    case 'R': room = optarg; break;
+    case 'f': fork_mode = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-n users] [-m msgs_per_user] [-r msgs_per_sec] [-s payload] [-R room] [-f]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (n_users < 2 || msgs < 1 || rate < 1 || payload < 0 || payload > FRAME_MAX - 128) {
+    fprintf(stderr, "chat_load: bad arguments\n");
+    return 2;
+  }
+
+  snprintf(room_dir, sizeof(room_dir), "/tmp/chatroom-%s", room);
+  mkdir(room_dir, 0777);
+  for (int u = 0; u < n_users; u++) {
+    char path[512];
+    user_path(path, sizeof(path), u);
+    mkfifo(path, 0666);
+  }
+
+  size_t shared_size = sizeof(struct shared) + sizeof(struct user_stats) * n_users;
+  struct shared *sh = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  signal(SIGPIPE, SIG_IGN);
+
+  uint64_t start = now_ns();
+  for (int u = 0; u < n_users; u++) {
+    if (fork() == 0) {
+      srand(u + 1);
+      run_user(u, sh);
+    }
+  }
+  while (wait(NULL) > 0) {}
+  double wall = (now_ns() - start) / 1e9;
+
+  struct user_stats total = {0};
+  for (int u = 0; u < n_users; u++) {
+    struct user_stats *st = &sh->users[u];
+    for (int b = 0; b < HIST_BUCKETS; b++) total.hist[b] += st->hist[b];
+    total.received += st->received;
+    total.gaps += st->gaps;
+    total.partial += st->partial;
+    total.send_eagain += st->send_eagain;
+    total.sent += st->sent;
+  }
+
+  uint64_t p50 = 0, p99 = 0, max = 0, seen = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++) {
+    if (total.hist[b] == 0) continue;
+    seen += total.hist[b];
+    if (!p50 && seen * 100 >= total.received * 50) p50 = hist_value(b);
+    if (!p99 && seen * 100 >= total.received * 99) p99 = hist_value(b);
+    max = hist_value(b);
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_CHILDREN, &ru);
+  double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  uint64_t expected = total.sent * (n_users - 1);
+
+  printf("room %s: %d users x %d msgs @ %d/s, %s senders\n", room, n_users, msgs, rate,
+         fork_mode ? "fork-per-recipient" : "fan-out");
+  printf("  sent %llu, deliveries %llu/%llu (%.2f%%), wall %.2f s\n",
+         (unsigned long long)total.sent, (unsigned long long)total.received,
+         (unsigned long long)expected, expected ? 100.0 * total.received / expected : 0, wall);
+  printf("  latency p50 %.1f us, p99 %.1f us, max %.1f us\n", p50 / 1e3, p99 / 1e3, max / 1e3);
+  printf("  dropped %llu (sender EAGAIN %llu), partial %llu\n", (unsigned long long)total.gaps,
+         (unsigned long long)total.send_eagain, (unsigned long long)total.partial);
+  printf("  cpu %.3f s: %.1f us per sent msg, %.2f us per delivery\n", cpu,
+         total.sent ? cpu * 1e6 / total.sent : 0, total.received ? cpu * 1e6 / total.received : 0);
+
+  for (int u = 0; u < n_users; u++) {
+    char path[512];
+    user_path(path, sizeof(path), u);
+    unlink(path);
+  }
+  rmdir(room_dir);
+  return 0;
+}
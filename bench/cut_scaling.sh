@@ -0,0 +1,37 @@
+#!/bin/sh
+# cut_scaling: throughput of shellish's `cut -j N` on a large TSV for N = 1..cores.
+# The input is generated once and kept (it's big), the file is warmed into the
+# page cache before timing so the numbers are about splitting, not the disk.
+#
+# usage: bench/cut_scaling.sh [shellish binary] [size_mb]
+SHELLISH=${1:-./shellish}
+SIZE_MB=${2:-512}
+INPUT=${TMPDIR:-/tmp}/shellish_cut_bench_${SIZE_MB}.tsv
+CORES=$(getconf _NPROCESSORS_ONLN)
+
+if [ ! -f "$INPUT" ]; then
+  awk -v bytes=$((SIZE_MB * 1024 * 1024)) 'BEGIN {
+    srand(1); n = 0
+    while (n < bytes) {
+      line = int(rand() * 1e9) "\t" "user" int(rand() * 1e5) "\t" int(rand() * 1e6) "\t" \
+             "GET\t/api/v1/items/" int(rand() * 1e7) "\t200\t" int(rand() * 1e4)
+      print line; n += length(line) + 1
+    }
+  }' > "$INPUT"
+fi
+cat "$INPUT" > /dev/null
+
+now() { date +%s.%N; }
+
+echo "input $INPUT (${SIZE_MB} MB), $CORES cores"
+base=""
+for j in $(awk -v c="$CORES" 'BEGIN { for (j = 1; j < c; j *= 2) print j; print c }'); do
+  start=$(now)
+  printf 'cut -j %d -f2,5-6 < %s > /dev/null\nexit\n' "$j" "$INPUT" | "$SHELLISH" > /dev/null
+  end=$(now)
+  [ -z "$base" ] && base=$(awk -v s="$start" -v e="$end" 'BEGIN { print e - s }')
+  awk -v j="$j" -v s="$start" -v e="$end" -v mb="$SIZE_MB" -v base="$base" 'BEGIN {
+    t = e - s
+    printf "  -j %-3d %7.3f s  %8.1f MB/s  speedup %.2fx\n", j, t, mb / t, base / t
+  }'
+done
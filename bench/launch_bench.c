@@ -0,0 +1,74 @@
+// launch_bench: per-command latency of fork+execv vs posix_spawn, the two ways
+// shellish can start an external command. The parent can be made "large" with
+// -m MB of touched memory to show the page-table copying cost of fork().
+//
+// usage: launch_bench [-n iterations] [-m ballast_mb] [command]
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double run_fork(const char *path, char **argv, int n) {
+  double start = now_us();
+  for (int i = 0; i < n; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      execv(path, argv);
+      _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return (now_us() - start) / n;
+}
+
+static double run_spawn(const char *path, char **argv, int n) {
+  double start = now_us();
+  for (int i = 0; i < n; i++) {
+    pid_t pid;
+    if (posix_spawn(&pid, path, NULL, NULL, argv, environ) != 0) return -1;
+    waitpid(pid, NULL, 0);
+  }
+  return (now_us() - start) / n;
+}
+
+int main(int argc, char **argv) {
+  int n = 2000;
+  size_t ballast_mb = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+    if (opt == 'n') n = atoi(optarg);
+    else if (opt == 'm') ballast_mb = strtoul(optarg, NULL, 10);
+    else {
+      fprintf(stderr, "usage: %s [-n iterations] [-m ballast_mb] [command]\n", argv[0]);
+      return 2;
+    }
+  }
+  char *path = optind < argc ? argv[optind] : "/bin/true";
+  char *child_argv[] = {path, NULL};
+
+  //touch every page so fork() really has page tables to copy
+  char *ballast = NULL;
+  if (ballast_mb > 0) {
+    ballast = malloc(ballast_mb << 20);
+    memset(ballast, 1, ballast_mb << 20);
+  }
+
+  double fork_us = run_fork(path, child_argv, n);
+  double spawn_us = run_spawn(path, child_argv, n);
+  printf("command %s, %d runs, parent ballast %zu MB\n", path, n, ballast_mb);
+  printf("  fork+execv : %8.1f us/cmd\n", fork_us);
+  printf("  posix_spawn: %8.1f us/cmd (%.2fx)\n", spawn_us, fork_us / spawn_us);
+  free(ballast);
+  return 0;
+}
@@ -0,0 +1,182 @@
+// parse_bench: time and allocations per command line for shellish's parser. the
+// shell is compiled in (its main renamed away) and parse_command runs on a set of
+// typical lines, or the lines of a file. the old parser (a malloc per name, arg and
+// redirect, a realloc per token, a recursive call per "|") is kept below as a
+// baseline, with its mallocs counted.
+//
+// usage: parse_bench [-n iterations] [lines_file]
+#define main shellish_main
+#include "../shellish-skeleton.c"
+#undef main
+
+static const char *default_lines[] = {
+  "ls -la",
+  "cd /tmp",
+  "grep -n -i error /var/log/syslog",
+  "cat < input.txt | sort -r | uniq -c | head -20 > out.txt",
+  "cut -d, -f1,3-5 < data.csv >> summary.csv",
+  "gcc -Wall -O2 -pthread -o shellish shellish-skeleton.c &",
+  "find . -name '*.c' -newer Makefile -type f",
+  "trash build/a.o build/b.o build/c.o build/d.o build/e.o build/f.o",
+  "ps aux | grep shellish | grep -v grep | wc -l",
+  "echo \"hello\" 'world' again and again and again",
+};
+
+static size_t legacy_mallocs;
+
+static void *lmalloc(size_t n) { legacy_mallocs++; return malloc(n); }
+static void *lrealloc(void *p, size_t n) { legacy_mallocs++; return realloc(p, n); }
+static char *lstrdup(const char *s) { legacy_mallocs++; return strdup(s); }
+
+//the parser as it was, allocation calls swapped for the counting ones
+static int legacy_parse(char *buf, struct command_t *command) {
+  const char *splitters = " \t";
+  int index, len;
+  len = strlen(buf);
+  while (len > 0 && strchr(splitters, buf[0]) != NULL) { buf++; len--; }
+  while (len > 0 && strchr(splitters, buf[len - 1]) != NULL) buf[--len] = 0;
+  if (len > 0 && buf[len - 1] == '?') command->auto_complete = true;
+  if (len > 0 && buf[len - 1] == '&') command->background = true;
+
+  char *pch = strtok(buf, splitters);
+  command->name = lstrdup(pch ? pch : "");
+  command->args = lmalloc(sizeof(char *));
+  int redirect_index, arg_index = 0;
+  char temp_buf[1024], *arg;
+  while (1) {
+    pch = strtok(NULL, splitters);
+    if (!pch) break;
+    arg = temp_buf;
+    strcpy(arg, pch);
+    len = strlen(arg);
+    if (len == 0) continue;
+    if (strcmp(arg, "|") == 0) {
+      struct command_t *c = calloc(1, sizeof(struct command_t));
+      legacy_mallocs++;
+      int l = strlen(pch);
+      pch[l] = splitters[0];
+      index = 1;
+      while (pch[index] == ' ' || pch[index] == '\t') index++;
+      legacy_parse(pch + index, c);
+      pch[l] = 0;
+      command->next = c;
+      continue;
+    }
+    if (strcmp(arg, "&") == 0) continue;
+    redirect_index = -1;
+    if (arg[0] == '<') redirect_index = 0;
+    if (arg[0] == '>') {
+      if (len > 1 && arg[1] == '>') { redirect_index = 2; arg++; len--; }
+      else redirect_index = 1;
+    }
+    if (redirect_index != -1) {
+      const char *target = arg + 1;
+      if (*target == 0) {
+        pch = strtok(NULL, splitters);
+        if (!pch) break;
+        target = pch;
+      }
+      command->redirects[redirect_index] = lstrdup(target);
+      continue;
+    }
+    if (len > 2 && ((arg[0] == '"' && arg[len - 1] == '"') || (arg[0] == '\'' && arg[len - 1] == '\''))) {
+      arg[--len] = 0;
+      arg++;
+    }
+    command->args = lrealloc(command->args, sizeof(char *) * (arg_index + 1));
+    command->args[arg_index] = lmalloc(len + 1);
+    strcpy(command->args[arg_index++], arg);
+  }
+  command->arg_count = arg_index;
+  command->args = lrealloc(command->args, sizeof(char *) * (command->arg_count += 2));
+  for (int i = command->arg_count - 2; i > 0; --i) command->args[i] = command->args[i - 1];
+  command->args[0] = lstrdup(command->name);
+  command->args[command->arg_count - 1] = NULL;
+  return 0;
+}
+
+static void legacy_free(struct command_t *command) {
+  for (int i = 0; i < command->arg_count; ++i) free(command->args[i]);
+  free(command->args);
+  for (int i = 0; i < 3; ++i) free(command->redirects[i]);
+  if (command->next) {
+    legacy_free(command->next);
+    free(command->next);
+  }
+  free(command->name);
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  long iterations = 200000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n') iterations = atol(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-n iterations] [lines_file]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  char **lines = (char **)default_lines;
+  size_t num_lines = sizeof(default_lines) / sizeof(default_lines[0]);
+  if (optind < argc) { // one command per line of the file
+    FILE *f = fopen(argv[optind], "r");
+    if (f == NULL) { perror(argv[optind]); return 1; }
+    lines = NULL;
+    num_lines = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, f)) > 0) {
+      if (line[n - 1] == '\n') line[n - 1] = 0;
+      lines = realloc(lines, sizeof(char *) * (num_lines + 1));
+      lines[num_lines++] = strdup(line);
+    }
+    free(line);
+    fclose(f);
+  }
+  size_t bytes = 0;
+  for (size_t i = 0; i < num_lines; i++) bytes += strlen(lines[i]);
+
+  //parse_command gets a scratch copy too (both parsers cut up their input), so the
+  //copy is paid on both sides
+  char scratch[65536];
+  struct arena arena = {0};
+  double start = now_ns();
+  for (long it = 0; it < iterations; it++) {
+    for (size_t i = 0; i < num_lines; i++) {
+      struct command_t command = {0};
+      command.arena = &arena;
+      snprintf(scratch, sizeof(scratch), "%s", lines[i]);
+      parse_command(scratch, &command);
+      arena_reset(&arena);
+    }
+  }
+  double arena_ns = (now_ns() - start) / ((double)iterations * num_lines);
+
+  start = now_ns();
+  for (long it = 0; it < iterations; it++) {
+    for (size_t i = 0; i < num_lines; i++) {
+      struct command_t command = {0};
+      snprintf(scratch, sizeof(scratch), "%s", lines[i]);
+      legacy_parse(scratch, &command);
+      legacy_free(&command);
+    }
+  }
+  double legacy_ns = (now_ns() - start) / ((double)iterations * num_lines);
+  double parsed = (double)iterations * num_lines;
+
+  printf("%zu lines (%.1f bytes avg) x %ld iterations\n", num_lines, (double)bytes / num_lines, iterations);
+  printf("  arena parser:  %7.1f ns/line  %6.1f MB/s  %.4f mallocs/line (%zu blocks total)\n", arena_ns,
+         bytes / (double)num_lines / arena_ns * 1e3, arena.mallocs / parsed, arena.mallocs);
+  printf("  legacy parser: %7.1f ns/line  %6.1f MB/s  %.1f mallocs/line\n", legacy_ns,
+         bytes / (double)num_lines / legacy_ns * 1e3, legacy_mallocs / parsed);
+  arena_release(&arena);
+  return 0;
+}
@@ -0,0 +1,329 @@
+// suite: the shell's hot paths in one run, reported as a JSON document so results
+// can be kept and compared across commits. like parse_bench, the shell is compiled
+// in (main renamed away) and driven through parse_command/process_command, so the
+// numbers include the shell's own wiring, not just the programs it starts.
+//
+//   parse     parse_command on typical lines: ns/line, MB/s, mallocs/line
+//   spawn     `true` through process_command: fork/exec (posix_spawn) + wait latency
+//   pipeline  head -c SIZE /dev/zero | cat | ... > /dev/null for 2..8 stages: MB/s
+//   cut       cut on a generated TSV and CSV file: MB/s
+//   trash     trash + trash restore of one file as the trash grows: us per operation
+//
+// whatever the shell prints goes to /dev/null, the JSON goes to stdout (or -o),
+// progress to stderr.
+//
+// usage: suite [-q] [-o out.json] [-r revision] [-s cut_mb] [-p pipe_mb] [-t trash_max]
+#define main shellish_main
+#include "../shellish-skeleton.c"
+#undef main
+
+#include <stdarg.h>
+#include <sys/utsname.h>
+
+static const char *parse_lines[] = {
+  "ls -la",
+  "cd /tmp",
+  "grep -n -i error /var/log/syslog",
+  "cat < input.txt | sort -r | uniq -c | head -20 > out.txt",
+  "cut -d, -f1,3-5 < data.csv >> summary.csv",
+  "gcc -Wall -O2 -pthread -o shellish shellish-skeleton.c &",
+  "find . -name '*.c' -newer Makefile -type f",
+  "trash build/a.o build/b.o build/c.o build/d.o build/e.o build/f.o",
+  "ps aux | grep shellish | grep -v grep | wc -l",
+  "parallel -j 8 gzip -k {} ::: a.log b.log c.log d.log",
+};
+
+static FILE *json;
+static bool quiet = false;
+static int num_results = 0;
+static char work_dir[PATH_MAX]; // scratch files, HOME for the trash
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void progress(const char *fmt, ...) {
+  if (quiet) return;
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+//one result object: its name, then flat key/value pairs
+static void result_begin(const char *name) {
+  fprintf(json, "%s\n    {\"name\": \"%s\"", num_results++ ? "," : "", name);
+}
+
+static void result_num(const char *key, double value) {
+  if (value == (long long)value) fprintf(json, ", \"%s\": %lld", key, (long long)value);
+  else fprintf(json, ", \"%s\": %.3f", key, value);
+}
+
+static void result_str(const char *key, const char *value) {
+  fprintf(json, ", \"%s\": \"%s\"", key, value);
+}
+
+static void result_end(void) {
+  fprintf(json, "}");
+}
+
+//a line through the shell, the way main runs it
+static void run_line(const char *line) {
+  static struct arena line_arena;
+  static char buf[1 << 16];
+  struct command_t *command = calloc(1, sizeof(struct command_t));
+  command->arena = &line_arena;
+  snprintf(buf, sizeof(buf), "%s", line);
+  parse_command(buf, command);
+  process_command(command);
+  free_command(command);
+}
+
+static void bench_parse(void) {
+  size_t num_lines = sizeof(parse_lines) / sizeof(parse_lines[0]);
+  size_t bytes = 0;
+  for (size_t i = 0; i < num_lines; i++) bytes += strlen(parse_lines[i]);
+  long iterations = 100000;
+  char scratch[1024];
+  struct arena arena = {0};
+  double start = now_ns();
+  for (long it = 0; it < iterations; it++)
+    for (size_t i = 0; i < num_lines; i++) {
+      struct command_t command = {0};
+      command.arena = &arena;
+      memcpy(scratch, parse_lines[i], strlen(parse_lines[i]) + 1);
+      parse_command(scratch, &command);
+      arena_reset(&arena);
+    }
+  double parsed = (double)iterations * num_lines;
+  double ns = (now_ns() - start) / parsed;
+  result_begin("parse");
+  result_num("lines", num_lines);
+  result_num("ns_per_line", ns);
+  result_num("mb_per_s", bytes / (double)num_lines / ns * 1e3);
+  result_num("mallocs_per_line", arena.mallocs / parsed);
+  result_end();
+  arena_release(&arena);
+  progress("parse: %.1f ns/line\n", ns);
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+//mean, p50, p99 of samples in ns, reported in us
+static void result_latency(double *samples, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++) sum += samples[i];
+  qsort(samples, n, sizeof(double), cmp_double);
+  result_num("mean_us", sum / n / 1e3);
+  result_num("p50_us", samples[n / 2] / 1e3);
+  result_num("p99_us", samples[n * 99 / 100] / 1e3);
+}
+
+static void bench_spawn(void) {
+  int n = 2000;
+  double *samples = malloc(sizeof(double) * n);
+  run_line("true"); // warms the hash cache
+  for (int i = 0; i < n; i++) {
+    double start = now_ns();
+    run_line("true");
+    samples[i] = now_ns() - start;
+  }
+  result_begin("spawn");
+  result_num("iterations", n);
+  result_latency(samples, n);
+  result_end();
+  progress("spawn: %.1f us p50\n", samples[n / 2] / 1e3);
+  free(samples);
+}
+
+static void bench_pipeline(long pipe_mb) {
+  int stages[] = {2, 3, 4, 8};
+  for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+    char line[1024];
+    int len = snprintf(line, sizeof(line), "head -c %ldM /dev/zero", pipe_mb);
+    for (int i = 1; i < stages[s]; i++) len += snprintf(line + len, sizeof(line) - len, " | cat");
+    snprintf(line + len, sizeof(line) - len, " > /dev/null");
+    double start = now_ns();
+    run_line(line);
+    double secs = (now_ns() - start) / 1e9;
+    result_begin("pipeline");
+    result_num("stages", stages[s]);
+    result_num("mb", pipe_mb);
+    result_num("mb_per_s", pipe_mb / secs);
+    result_end();
+    progress("pipeline %d stages: %.1f MB/s\n", stages[s], pipe_mb / secs);
+  }
+}
+
+//a log-like table, same shape as cut_scaling.sh makes
+static void make_table(const char *path, long mb, char sep) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) return;
+  long bytes = 0, target = mb << 20;
+  unsigned seed = 1;
+  while (bytes < target) {
+    bytes += fprintf(f, "%d%cuser%d%c%d%cGET%c/api/v1/items/%d%c200%c%d\n", rand_r(&seed) % 1000000000, sep,
+                     rand_r(&seed) % 100000, sep, rand_r(&seed) % 1000000, sep, sep,
+                     rand_r(&seed) % 10000000, sep, sep, rand_r(&seed) % 10000);
+  }
+  fclose(f);
+}
+
+static void bench_cut(long cut_mb) {
+  struct { const char *name; char sep; const char *args; } kinds[] = {
+    {"tsv", '\t', "-f2,5-6"},
+    {"csv", ',', "-d, -f2,5-6"},
+  };
+  for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+    char path[PATH_MAX + 16], line[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/table.%s", work_dir, kinds[k].name);
+    make_table(path, cut_mb, kinds[k].sep);
+    snprintf(line, sizeof(line), "cut %s < %s > /dev/null", kinds[k].args, path);
+    run_line(line); // warm page cache
+    double best = 0;
+    for (int rep = 0; rep < 3; rep++) {
+      double start = now_ns();
+      run_line(line);
+      double secs = (now_ns() - start) / 1e9;
+      if (best == 0 || secs < best) best = secs;
+    }
+    result_begin("cut");
+    result_str("format", kinds[k].name);
+    result_num("mb", cut_mb);
+    result_num("mb_per_s", cut_mb / best);
+    result_end();
+    progress("cut %s: %.1f MB/s\n", kinds[k].name, cut_mb / best);
+    unlink(path);
+  }
+}
+
+static void touch(const char *name) {
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd != -1) {
+    ssize_t r = write(fd, "x\n", 2);
+    (void)r;
+    close(fd);
+  }
+}
+
+//trash/restore of one small file with the trash already holding `size` entries
+static void bench_trash(long trash_max) {
+  char files[PATH_MAX + 8];
+  snprintf(files, sizeof(files), "%s/files", work_dir);
+  mkdir(files, 0755);
+  if (chdir(files) == -1) return;
+  setenv("HOME", work_dir, 1);
+
+  long size = 0, next = 0;
+  for (long target = 0;; target = target ? target * 10 : 100) {
+    if (target > trash_max) target = trash_max;
+    //grow the trash to the target, a few hundred names per command
+    while (size < target) {
+      char line[1 << 15];
+      int len = snprintf(line, sizeof(line), "trash");
+      for (int i = 0; i < 500 && size < target; i++, size++) {
+        char name[32];
+        snprintf(name, sizeof(name), "f%ld", next++);
+        touch(name);
+        len += snprintf(line + len, sizeof(line) - len, " %s", name);
+      }
+      run_line(line);
+    }
+
+    int n = 200;
+    double *trash_ns = malloc(sizeof(double) * n), *restore_ns = malloc(sizeof(double) * n);
+    for (int i = 0; i < n; i++) {
+      touch("probe");
+      double start = now_ns();
+      run_line("trash probe");
+      double mid = now_ns();
+      run_line("trash restore probe");
+      trash_ns[i] = mid - start;
+      restore_ns[i] = now_ns() - mid;
+    }
+    unlink("probe");
+    result_begin("trash");
+    result_num("entries", size);
+    result_latency(trash_ns, n);
+    result_end();
+    result_begin("trash_restore");
+    result_num("entries", size);
+    result_latency(restore_ns, n);
+    result_end();
+    progress("trash with %ld entries: %.1f us trash, %.1f us restore (p50)\n", size, trash_ns[n / 2] / 1e3,
+             restore_ns[n / 2] / 1e3);
+    free(trash_ns);
+    free(restore_ns);
+    if (target == trash_max) break;
+  }
+  if (chdir(work_dir) == -1) return;
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL, *revision = "unknown";
+  long cut_mb = 64, pipe_mb = 512, trash_max = 10000;
+  int opt;
+  while ((opt = getopt(argc, argv, "qo:r:s:p:t:")) != -1) {
+    switch (opt) {
+    case 'q': quiet = true; break;
+    case 'o': out_path = optarg; break;
+    case 'r': revision = optarg; break;
+    case 's': cut_mb = atol(optarg); break;
+    case 'p': pipe_mb = atol(optarg); break;
+    case 't': trash_max = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-q] [-o out.json] [-r revision] [-s cut_mb] [-p pipe_mb] [-t trash_max]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (cut_mb < 1 || pipe_mb < 1 || trash_max < 0) {
+    fprintf(stderr, "suite: bad arguments\n");
+    return 2;
+  }
+
+  //the JSON keeps the real stdout, the shell's chatter goes nowhere
+  int json_fd = out_path ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : dup(STDOUT_FILENO);
+  if (json_fd == -1) {
+    perror(out_path ? out_path : "dup");
+    return 1;
+  }
+  json = fdopen(json_fd, "w");
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+
+  snprintf(work_dir, sizeof(work_dir), "%s/shellish-suite-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+  if (mkdtemp(work_dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  if (chdir(work_dir) == -1) return 1;
+
+  struct utsname un;
+  uname(&un);
+  fprintf(json, "{\n  \"suite\": \"shellish\",\n  \"revision\": \"%s\",\n  \"timestamp\": %ld,\n", revision,
+          (long)time(NULL));
+  fprintf(json, "  \"host\": {\"kernel\": \"%s\", \"machine\": \"%s\", \"cores\": %ld},\n", un.release,
+          un.machine, sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(json, "  \"results\": [");
+
+  bench_parse();
+  bench_spawn();
+  bench_pipeline(pipe_mb);
+  bench_cut(cut_mb);
+  bench_trash(trash_max);
+
+  fprintf(json, "\n  ]\n}\n");
+  fclose(json);
+
+  //the scratch dir, trash and all
+  if (chdir("/") == 0) trash_remove_tree(AT_FDCWD, work_dir);
+  return 0;
+}
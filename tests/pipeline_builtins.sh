@@ -0,0 +1,39 @@
+#!/bin/sh
+# builtins that change the shell (cd, exit, ...) must not touch it when they're a
+# pipeline stage: they get their own process like any other stage.
+# usage: tests/pipeline_builtins.sh [path/to/shellish]
+sh_bin=${1:-./shellish}
+fail=0
+
+check() { # name expected actual
+  if [ "$2" = "$3" ]; then
+    echo "ok    $1"
+  else
+    echo "FAIL  $1: expected '$2', got '$3'"
+    fail=1
+  fi
+}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# cd at the end of a pipeline leaves the shell's cwd alone
+out=$(printf 'echo a | cd /\npwd\n' | "$sh_bin")
+check "echo a | cd / keeps the cwd" "$dir" "$out"
+
+# exit at the end of a pipeline neither exits the shell nor sets its exit status
+out=$(printf 'echo a | exit 5\necho still here\ntrue\n' | "$sh_bin")
+status=$?
+check "echo a | exit 5 doesn't exit" "still here" "$out"
+check "echo a | exit 5 doesn't set the final status" 0 "$status"
+
+# the pipeline's own status is the stage's exit code
+printf 'echo a | exit 5\n' | "$sh_bin"
+check "echo a | exit 5 is the pipeline's status" 5 $?
+
+# a builtin that doesn't change the shell still reads the pipe in the shell
+out=$(printf 'echo a:b | cut -d : -f 2\n' | "$sh_bin")
+check "echo a:b | cut -f 2" b "$out"
+
+exit $fail
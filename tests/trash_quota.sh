@@ -0,0 +1,39 @@
+#!/bin/sh
+# the size quota pushes old entries out of the trash, never the ones being trashed:
+# a file bigger than the whole quota is kept (with a warning), not deleted.
+# usage: tests/trash_quota.sh [path/to/shellish]
+sh_bin=$(cd "$(dirname "${1:-./shellish}")" && pwd)/$(basename "${1:-./shellish}")
+fail=0
+
+check() { # name expected actual
+  if [ "$2" = "$3" ]; then
+    echo "ok    $1"
+  else
+    echo "FAIL  $1: expected '$2', got '$3'"
+    fail=1
+  fi
+}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export HOME="$dir"
+mkdir "$dir/w" && cd "$dir/w" || exit 1
+
+printf 'trash --quota size 1K\n' | "$sh_bin" > /dev/null
+head -c 600 /dev/zero > old
+printf 'trash old\n' | "$sh_bin"
+check "a file under the quota is trashed" "" "$(ls)"
+
+# bigger than the quota on its own: kept, and the older entry makes room
+head -c 5000 /dev/zero > keep
+out=$(printf 'trash keep\n' | "$sh_bin")
+status=$?
+check "trashing an oversize file succeeds" 0 "$status"
+check "trashing an oversize file warns" "-shellish: trash: over quota, 5000 bytes kept (limit 1K)" "$out"
+check "the oversize file is still in the trash" 1 "$(printf 'trash ls\n' | "$sh_bin" | grep -c ' keep ')"
+check "the older entry was purged for it" 0 "$(printf 'trash ls\n' | "$sh_bin" | grep -c ' old ')"
+
+printf 'trash restore keep\n' | "$sh_bin"
+check "the oversize file restores whole" 5000 "$(wc -c < keep | tr -d ' ')"
+
+exit $fail